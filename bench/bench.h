@@ -0,0 +1,70 @@
+/*
+
+    Helpers shared by the benchmarks in this directory: a reproducible
+    random number generator, timing and a runner that gives every
+    workload or scenario a child process of its own.
+
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Returns a number below bound from the linear congruential generator
+   whose state is pointed to by state. The same seed gives the same
+   sequence on every run. */
+static inline size_t bench_rng(unsigned long long *state, size_t bound) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (size_t) ((*state >> 33) % (unsigned long long) bound);
+}
+
+/* Seconds elapsed since start, read from CLOCK_MONOTONIC */
+static inline double bench_seconds_since(const struct timespec *start) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double) (end.tv_sec - start->tv_sec) + 1e-9 * (double) (end.tv_nsec - start->tv_nsec);
+}
+
+/* Calls run(index, result) in a child process and copies the size
+   bytes at result back from the child through a pipe (they are zeroed
+   if that fails). If usage is not NULL, it receives the resource usage
+   of the child. Returns non-zero if run returned non-zero and the
+   child exited normally. */
+static inline int bench_run_child(int (*run)(size_t, void *), size_t index,
+				  void *result, size_t size, struct rusage *usage) {
+  struct rusage ignored;
+  int fds[2], status, ok;
+  pid_t pid;
+
+  if (pipe(fds) != 0) return 0;
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    ok = run(index, result);
+    if (write(fds[1], result, size) != (ssize_t) size) _exit(1);
+    _exit(ok ? 0 : 1);
+  }
+  close(fds[1]);
+  ok = (read(fds[0], result, size) == (ssize_t) size);
+  if (!ok) memset(result, 0, size);
+  close(fds[0]);
+  if (usage == NULL) usage = &ignored;
+  if ((wait4(pid, &status, 0, usage) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) ok = 0;
+  return ok;
+}
+
+#endif
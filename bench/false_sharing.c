@@ -0,0 +1,146 @@
+/*  
+
+    Multi-threaded counter benchmark for the false-sharing-aware
+    placement of small blocks.
+
+    Every thread increments a counter of its own. The benchmark runs
+    twice: once with all counters packed into a single array (so that
+    they share cache lines, the worst case) and once with every thread
+    allocating its counter with malloc. With small blocks coming from
+    thread-owned spans, the second run must never report shared lines
+    and should be about as fast as if the threads did not interfere.
+
+    Compile it against the allocator like that:
+
+    gcc -Wall -O2 -pthread -o false_sharing bench/false_sharing.c memory.c implementation.c
+
+    and, for the cache-line size-class mode:
+
+    gcc -Wall -O2 -pthread -DCACHE_LINE_CLASSES -o false_sharing bench/false_sharing.c memory.c implementation.c
+
+    Building it without memory.c and implementation.c gives the numbers
+    for the libc allocator. "make bench/false_sharing" and "make
+    bench/false_sharing-cache-lines" build the two variants above,
+    "make false-sharing" builds and runs both.
+
+    Usage: ./false_sharing [threads] [iterations]
+
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#define CACHE_LINE_SIZE 64
+
+#ifdef CACHE_LINE_CLASSES
+#define CLASS_MODE "cache-line"
+#else
+#define CLASS_MODE "16-byte"
+#endif
+#define MAX_THREADS 64
+
+static long iterations = 50000000L;
+static pthread_barrier_t barrier;
+
+/* Counters of the packed run, one after the other */
+static volatile long *packed;
+
+/* Counters of the malloc run, allocated by each thread itself */
+static volatile long *counters[MAX_THREADS];
+
+static void increment(volatile long *counter) {
+  long i;
+
+  for (i=0L; i<iterations; i++) {
+    (*counter)++;
+  }
+}
+
+static void *packed_worker(void *arg) {
+  size_t id = (size_t) arg;
+
+  pthread_barrier_wait(&barrier);
+  increment(&packed[id]);
+  return NULL;
+}
+
+static void *malloc_worker(void *arg) {
+  size_t id = (size_t) arg;
+
+  counters[id] = malloc(sizeof(long));
+  if (counters[id] == NULL) return NULL;
+  *counters[id] = 0L;
+  pthread_barrier_wait(&barrier);
+  increment(counters[id]);
+  return NULL;
+}
+
+static double run(size_t threads, void *(*worker)(void *)) {
+  pthread_t tids[MAX_THREADS];
+  struct timespec start, end;
+  size_t i;
+
+  pthread_barrier_init(&barrier, NULL, (unsigned) threads + 1u);
+  for (i=0; i<threads; i++) {
+    pthread_create(&tids[i], NULL, worker, (void *) i);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_barrier_wait(&barrier);
+  for (i=0; i<threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  pthread_barrier_destroy(&barrier);
+  return (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec);
+}
+
+/* Counts the pairs of threads whose counters live on the same cache line */
+static size_t shared_lines(size_t threads) {
+  size_t i, j, shared;
+
+  shared = 0;
+  for (i=0; i<threads; i++) {
+    for (j=i+1; j<threads; j++) {
+      if ((size_t) counters[i] / CACHE_LINE_SIZE == (size_t) counters[j] / CACHE_LINE_SIZE) shared++;
+    }
+  }
+  return shared;
+}
+
+int main(int argc, char **argv) {
+  size_t threads = 4;
+  size_t i;
+  double t_packed, t_malloc;
+
+  if (argc > 1) threads = (size_t) atol(argv[1]);
+  if (argc > 2) iterations = atol(argv[2]);
+  if ((threads < 1) || (threads > MAX_THREADS) || (iterations < 1L)) {
+    fprintf(stderr, "usage: %s [threads (1-%d)] [iterations]\n", argv[0], MAX_THREADS);
+    return 1;
+  }
+
+  packed = calloc(threads, sizeof(long));
+  if (packed == NULL) return 1;
+  t_packed = run(threads, packed_worker);
+  t_malloc = run(threads, malloc_worker);
+  for (i=0; i<threads; i++) {
+    if (counters[i] == NULL) {
+      fprintf(stderr, "malloc failed in thread %zu\n", i);
+      return 1;
+    }
+  }
+
+  printf("threads %zu, %ld increments each, %s size classes\n", threads, iterations, CLASS_MODE);
+  printf("packed counters:       %8.3f s\n", t_packed);
+  printf("per-thread malloc:     %8.3f s, %zu pairs of threads sharing a cache line\n",
+	 t_malloc, shared_lines(threads));
+
+  for (i=0; i<threads; i++) {
+    free((void *) counters[i]);
+  }
+  free((void *) packed);
+  return 0;
+}
@@ -0,0 +1,188 @@
+/*  
+
+    Comparison harness for the compile-time variants of the allocator
+    in implementation.c (placement policy and header layout).
+
+    The harness is linked with memory.c and implementation.c built for
+    one variant, so every malloc/realloc/free of the process goes to
+    that variant. It is built with -DNO_SPANS: requests of up to 1 KiB
+    would otherwise be served from per-thread spans, which work the
+    same in every variant, and small-churn would compare nothing.
+    Each workload runs in a child process of its own and the harness
+    prints one table row per workload:
+
+    * throughput in million allocator calls per second,
+    * peak resident set size of the child, as reported by wait4,
+    * peak bytes mapped by the allocator, from memory_stats,
+    * fragmentation, i.e. the share of the peak mapping that did not
+      hold requested bytes at the peak of live requested bytes.
+
+    Run "make bench" to build all variants and print the whole table.
+    "harness --header" prints the table header only.
+
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../memory_stats.h"
+#include "bench.h"
+
+#ifndef VARIANT
+#define VARIANT "default"
+#endif
+
+struct result {
+  size_t calls;
+  double seconds;
+  size_t peak_live;
+  size_t peak_mapped;
+  int failed;
+};
+
+static unsigned long long rng_state;
+
+/* Sizes spread evenly over the orders of magnitude between lo and hi */
+static size_t log_size(size_t lo, size_t hi) {
+  size_t size = lo;
+
+  while ((size * 2 <= hi) && (bench_rng(&rng_state, 2) == 0)) size *= 2;
+  return size + bench_rng(&rng_state, size);
+}
+
+static size_t live, peak_live;
+
+static void *track_alloc(void *ptr, size_t size, size_t old_size, struct result *r) {
+  r->calls++;
+  if (ptr == NULL) {
+    r->failed = 1;
+    return NULL;
+  }
+  memset(ptr, 0xa5, size);
+  live += size - old_size;
+  if (live > peak_live) peak_live = live;
+  return ptr;
+}
+
+static void track_free(void *ptr, size_t size, struct result *r) {
+  r->calls++;
+  free(ptr);
+  live -= size;
+}
+
+/* Replaces random slots of a fixed working set over and over */
+static void churn(struct result *r, size_t slots, size_t ops, size_t lo, size_t hi) {
+  void **ptrs = calloc(slots, sizeof(void *));
+  size_t *sizes = calloc(slots, sizeof(size_t));
+  size_t i, j;
+
+  if ((ptrs == NULL) || (sizes == NULL)) {
+    r->failed = 1;
+    return;
+  }
+  for (i=0; (i<ops) && !r->failed; i++) {
+    j = bench_rng(&rng_state, slots);
+    if (ptrs[j] != NULL) track_free(ptrs[j], sizes[j], r);
+    sizes[j] = log_size(lo, hi);
+    ptrs[j] = track_alloc(malloc(sizes[j]), sizes[j], 0, r);
+  }
+  for (j=0; j<slots; j++) {
+    if (ptrs[j] != NULL) track_free(ptrs[j], sizes[j], r);
+  }
+  free(ptrs);
+  free(sizes);
+}
+
+static void small_churn(struct result *r) {
+  churn(r, 10000, 1000000, 8, 256);
+}
+
+static void mixed_churn(struct result *r) {
+  churn(r, 2000, 300000, 16, 16384);
+}
+
+static void large_churn(struct result *r) {
+  churn(r, 256, 50000, 2048, 262144);
+}
+
+/* Grows many buffers step by step with realloc, then drops them */
+static void realloc_grow(struct result *r) {
+  void *ptrs[1000];
+  size_t sizes[1000];
+  size_t i, j, size;
+
+  for (i=0; i<1000; i++) {
+    ptrs[i] = NULL;
+    sizes[i] = 0;
+  }
+  for (j=0; (j<64) && !r->failed; j++) {
+    for (i=0; (i<1000) && !r->failed; i++) {
+      size = sizes[i] + 16 + bench_rng(&rng_state, 1024);
+      ptrs[i] = track_alloc(realloc(ptrs[i], size), size, sizes[i], r);
+      sizes[i] = size;
+    }
+  }
+  for (i=0; i<1000; i++) {
+    if (ptrs[i] != NULL) track_free(ptrs[i], sizes[i], r);
+  }
+}
+
+static const struct {
+  const char *name;
+  void (*run)(struct result *);
+} workloads[] = {
+  { "small-churn", small_churn },
+  { "mixed-churn", mixed_churn },
+  { "large-churn", large_churn },
+  { "realloc-grow", realloc_grow }
+};
+
+/* Runs workload w in the calling (child) process, failures end up in
+   the result */
+static int run_workload(size_t w, void *result) {
+  struct result *r = result;
+  struct timespec start;
+  struct memory_stats stats;
+
+  memset(r, 0, sizeof(*r));
+  rng_state = 42ULL;
+  live = 0;
+  peak_live = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  workloads[w].run(r);
+  r->seconds = bench_seconds_since(&start);
+  memory_stats(&stats);
+  r->peak_live = peak_live;
+  r->peak_mapped = stats.peak_mapped_bytes;
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  struct result r;
+  struct rusage usage;
+  size_t w;
+
+  if ((argc > 1) && !strcmp(argv[1], "--header")) {
+    printf("%-20s %-14s %10s %12s %14s %8s\n",
+	   "variant", "workload", "Mcalls/s", "peak RSS KiB", "peak map KiB", "frag %");
+    return 0;
+  }
+
+  for (w=0; w<sizeof(workloads)/sizeof(workloads[0]); w++) {
+    if (!bench_run_child(run_workload, w, &r, sizeof(r), &usage)) r.failed = 1;
+    if (r.failed) {
+      printf("%-20s %-14s %10s\n", VARIANT, workloads[w].name, "failed");
+      continue;
+    }
+    printf("%-20s %-14s %10.2f %12ld %14zu %8.1f\n",
+	   VARIANT, workloads[w].name,
+	   1e-6 * (double) r.calls / r.seconds,
+	   usage.ru_maxrss,
+	   r.peak_mapped / 1024,
+	   (r.peak_mapped == 0) ? 0.0 : 100.0 * (1.0 - (double) r.peak_live / (double) r.peak_mapped));
+  }
+  return 0;
+}
@@ -0,0 +1,270 @@
+/*
+
+    Memory-pressure scenarios for the reclaim stages of implementation.c.
+
+    Every scenario runs in a child process of its own. It first leaves
+    memory behind that the allocator holds on to without using it, then
+    caps its address space with RLIMIT_AS just above what is mapped at
+    that point and asks for memory that only fits once the reclaim
+    stages have given something back:
+
+    * idle-spans: threads that wait with empty spans (stage 1),
+
+    * freed-heap: a heap whose blocks have all been freed. Every policy
+      keeps one mapping of it as the spare one, which stage 3 gives back.
+
+    * fragmented: a run of freed neighbors in front of the free end of a
+      heap mapping and a request that only fits once they are merged.
+      The segregated policy does not merge on a miss before less than
+      64 KiB have been freed, so only stage 2 merges them. The list
+      policies merge on free and serve the request right away.
+
+    * hopeless: a request far beyond the cap must fail cleanly, and the
+      memory the program frees afterwards must serve new requests.
+
+    * live-span: the same failed request while the thread holds a small
+      block. The reclaim stages must leave the thread's span alone, so
+      that the next small request is served from what is left of it.
+
+    The program prints the counters of memory_stats per scenario and
+    exits with a non-zero status if the allocator does not behave as
+    described.
+
+    "make pressure" builds and runs it for every variant.
+
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "../memory_stats.h"
+#include "bench.h"
+
+#ifndef VARIANT
+#define VARIANT "default"
+#endif
+
+#define THREADS 16
+#define BLOCKS_PER_THREAD 500
+#define PIECES 96
+#define PIECE_SIZE ((size_t) 8000)
+#define NEIGHBORS 8
+#define MERGED_SIZE ((size_t) 200 * 1024)
+#define SMALL_BLOCKS 1000
+#define HEADROOM ((size_t) 16384)
+#define SPANS_SIZE ((size_t) 512 * 1024)
+#define HOPELESS_SIZE ((size_t) 64 * 1024 * 1024)
+
+static pthread_barrier_t allocated, done;
+
+/* Allocates small blocks, frees them again and waits until the main
+   thread is done, which leaves the thread's span mapped but unused */
+static void *worker(void *arg) {
+  void *ptrs[BLOCKS_PER_THREAD];
+  size_t i;
+
+  (void) arg;
+  for (i=0; i<BLOCKS_PER_THREAD; i++) {
+    ptrs[i] = malloc(16 + i % 96);
+    if (ptrs[i] != NULL) *(volatile char *) ptrs[i] = 1;
+  }
+  for (i=0; i<BLOCKS_PER_THREAD; i++) {
+    free(ptrs[i]);
+  }
+  pthread_barrier_wait(&allocated);
+  pthread_barrier_wait(&done);
+  return NULL;
+}
+
+/* Size of the address space of the process, read without allocating */
+static size_t address_space_size(void) {
+  char buf[128];
+  ssize_t n;
+  int fd;
+
+  fd = open("/proc/self/statm", O_RDONLY);
+  if (fd < 0) return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) return 0;
+  buf[n] = '\0';
+  return (size_t) strtoul(buf, NULL, 10) * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+/* Caps the address space HEADROOM bytes above its current size */
+static int cap_address_space(void) {
+  struct rlimit limit;
+  size_t vm;
+
+  vm = address_space_size();
+  if (vm == 0) return 0;
+  limit.rlim_cur = (rlim_t) (vm + HEADROOM);
+  limit.rlim_max = RLIM_INFINITY;
+  return setrlimit(RLIMIT_AS, &limit) == 0;
+}
+
+/* Stage 1: the spans of idle threads make room for a large block */
+static int idle_spans(struct memory_stats *stats) {
+  pthread_t tids[THREADS];
+  void *ptr;
+  size_t i;
+  int ok;
+
+  pthread_barrier_init(&allocated, NULL, THREADS + 1);
+  pthread_barrier_init(&done, NULL, THREADS + 1);
+  for (i=0; i<THREADS; i++) {
+    if (pthread_create(&tids[i], NULL, worker, NULL) != 0) return 0;
+  }
+  pthread_barrier_wait(&allocated);
+  if (!cap_address_space()) return 0;
+
+  ptr = malloc(SPANS_SIZE);
+  if (ptr != NULL) memset(ptr, 0x5a, SPANS_SIZE);
+  memory_stats(stats);
+  ok = (ptr != NULL) && (stats->reclaim_flushes > 0);
+  free(ptr);
+
+  pthread_barrier_wait(&done);
+  for (i=0; i<THREADS; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  return ok;
+}
+
+/* Stage 3: the spare mapping of a freed heap makes room for the new
+   spans small blocks need */
+static int freed_heap(struct memory_stats *stats) {
+  void *pieces[PIECES];
+  void *ptrs[SMALL_BLOCKS];
+  size_t i;
+  int ok = 1;
+
+  for (i=0; i<PIECES; i++) {
+    pieces[i] = malloc(PIECE_SIZE);
+    if (pieces[i] == NULL) return 0;
+    *(volatile char *) pieces[i] = 1;
+  }
+  for (i=0; i<PIECES; i++) {
+    free(pieces[i]);
+  }
+  if (!cap_address_space()) return 0;
+
+  for (i=0; i<SMALL_BLOCKS; i++) {
+    ptrs[i] = malloc(100);
+    if (ptrs[i] == NULL) ok = 0;
+    else *(volatile char *) ptrs[i] = 1;
+  }
+  memory_stats(stats);
+  if (stats->reclaim_purges == 0) ok = 0;
+  for (i=0; i<SMALL_BLOCKS; i++) {
+    free(ptrs[i]);
+  }
+  return ok;
+}
+
+/* Stage 2 (segregated): merging freed neighbors with the free end of
+   their mapping makes room for a block bigger than that end */
+static int fragmented(struct memory_stats *stats) {
+  void *pieces[NEIGHBORS];
+  void *ptr;
+  size_t i;
+  int ok;
+
+  for (i=0; i<NEIGHBORS; i++) {
+    pieces[i] = malloc(PIECE_SIZE);
+    if (pieces[i] == NULL) return 0;
+    *(volatile char *) pieces[i] = 1;
+  }
+  /* The first piece keeps the mapping in use, the others (less than
+     64 KiB together) are freed back to back up to the free end */
+  for (i=1; i<NEIGHBORS; i++) {
+    free(pieces[i]);
+  }
+  if (!cap_address_space()) return 0;
+
+  ptr = malloc(MERGED_SIZE);
+  if (ptr != NULL) memset(ptr, 0x5a, MERGED_SIZE);
+  memory_stats(stats);
+  ok = (ptr != NULL);
+#ifdef EXPECT_COALESCE
+  if (stats->reclaim_coalesces == 0) ok = 0;
+#endif
+  free(ptr);
+  free(pieces[0]);
+  return ok;
+}
+
+/* No stage can help: the request fails, freed memory is usable again */
+static int hopeless(struct memory_stats *stats) {
+  void *before, *ptr, *after;
+  int ok;
+
+  before = malloc(100);
+  if (before == NULL || !cap_address_space()) return 0;
+  ptr = malloc(HOPELESS_SIZE);
+  free(before);
+  after = malloc(100);
+  memory_stats(stats);
+  ok = (ptr == NULL) && (after != NULL) && (stats->out_of_memory > 0);
+  free(ptr);
+  free(after);
+  return ok;
+}
+
+/* A failed request must not cost the thread the rest of its span */
+static int live_span(struct memory_stats *stats) {
+  void *before, *ptr, *after;
+  int ok;
+
+  before = malloc(100);
+  if (before == NULL) return 0;
+  *(volatile char *) before = 1;
+  if (!cap_address_space()) return 0;
+  ptr = malloc(HOPELESS_SIZE);
+  after = malloc(100);
+  memory_stats(stats);
+  ok = (ptr == NULL) && (after != NULL) && (stats->out_of_memory == 1);
+  free(ptr);
+  free(after);
+  free(before);
+  return ok;
+}
+
+static const struct {
+  const char *name;
+  int (*run)(struct memory_stats *);
+} scenarios[] = {
+  { "idle-spans", idle_spans },
+  { "freed-heap", freed_heap },
+  { "fragmented", fragmented },
+  { "hopeless", hopeless },
+  { "live-span", live_span }
+};
+
+/* Runs scenario s in the calling (child) process */
+static int run_scenario(size_t s, void *stats) {
+  memset(stats, 0, sizeof(struct memory_stats));
+  return scenarios[s].run(stats);
+}
+
+int main(void) {
+  struct memory_stats stats;
+  size_t s;
+  int ok;
+  int failed = 0;
+
+  for (s=0; s<sizeof(scenarios)/sizeof(scenarios[0]); s++) {
+    ok = bench_run_child(run_scenario, s, &stats, sizeof(stats), NULL);
+    if (!ok) failed = 1;
+    printf("%-20s %-11s %-6s mmap failures %zu, span flushes %zu, coalesces %zu, purges %zu, recoveries %zu, out of memory %zu\n",
+	   VARIANT, scenarios[s].name, ok ? "ok" : "FAILED",
+	   stats.mmap_failures, stats.reclaim_flushes, stats.reclaim_coalesces,
+	   stats.reclaim_purges, stats.reclaim_recoveries, stats.out_of_memory);
+  }
+  return failed;
+}
@@ -0,0 +1,156 @@
+/*
+
+    Benchmark and check for the region (arena) API of region.h.
+
+    Every round builds the same object graph in a region: nodes of
+    mixed sizes and alignments up to 256 bytes, each pointing to an
+    earlier node, plus one object larger than a chunk. The round ends
+    with region_reset. The program checks that
+
+    * every object is aligned as requested,
+
+    * the second round gets exactly the addresses of the first one,
+      hence draws no new heap chunk (a new chunk could not overlap the
+      chunks the region still holds), and needs no new mapping, i.e.
+      the counters of memory_stats do not move across the reset,
+
+    and then compares the time of many such rounds against building
+    the same graph with one malloc and one free per object (malloc
+    only guarantees 16-byte alignment, so the larger alignments are
+    not honored there).
+
+    It exits with a non-zero status if a check fails. "make region"
+    builds and runs it for every variant.
+
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../memory_stats.h"
+#include "../region.h"
+#include "bench.h"
+
+#ifndef VARIANT
+#define VARIANT "default"
+#endif
+
+#define OBJECTS 4000
+#define ROUNDS 200
+#define CHUNK_SIZE ((size_t) 65536)
+#define OVERSIZED ((size_t) 3 * CHUNK_SIZE)
+
+struct node {
+  struct node *link;
+  size_t size;
+};
+
+static const size_t alignments[] = { 0, 16, 32, 64, 128, 256 };
+
+static size_t sizes[OBJECTS], aligns[OBJECTS];
+static void *ptrs[OBJECTS];
+static void *first_round[OBJECTS];
+
+static unsigned long long rng_state;
+
+/* Draws the sizes and alignments of the graph, the same for every round */
+static void make_graph(void) {
+  size_t i, size;
+
+  rng_state = 42ULL;
+  for (i=0; i<OBJECTS; i++) {
+    size = sizeof(struct node);
+    while ((size * 2 <= 1024) && (bench_rng(&rng_state, 2) == 0)) size *= 2;
+    sizes[i] = size + bench_rng(&rng_state, size);
+    aligns[i] = alignments[bench_rng(&rng_state, sizeof(alignments) / sizeof(alignments[0]))];
+  }
+  sizes[OBJECTS / 2] = OVERSIZED;
+}
+
+/* Links node i to an earlier node, touching both */
+static void link_node(size_t i) {
+  struct node *n = ptrs[i];
+
+  n->link = (i == 0) ? NULL : (struct node *) ptrs[bench_rng(&rng_state, i)];
+  n->size = sizes[i];
+}
+
+/* Builds the graph in the region, returns 0 if an object is missing or
+   misaligned */
+static int build_in_region(region_t *region) {
+  size_t i, align;
+
+  for (i=0; i<OBJECTS; i++) {
+    ptrs[i] = region_alloc(region, sizes[i], aligns[i]);
+    if (ptrs[i] == NULL) return 0;
+    align = (aligns[i] == 0) ? 16 : aligns[i];
+    if (((uintptr_t) ptrs[i] & (uintptr_t) (align - 1)) != 0) return 0;
+    link_node(i);
+  }
+  return 1;
+}
+
+/* Builds the graph with malloc and frees it object by object */
+static int build_with_malloc(void) {
+  size_t i;
+
+  for (i=0; i<OBJECTS; i++) {
+    ptrs[i] = malloc(sizes[i]);
+    if (ptrs[i] == NULL) return 0;
+    link_node(i);
+  }
+  for (i=0; i<OBJECTS; i++) {
+    free(ptrs[i]);
+  }
+  return 1;
+}
+
+int main(void) {
+  struct memory_stats before, after;
+  struct timespec start;
+  double region_time, malloc_time;
+  region_t *region;
+  size_t r;
+  int ok = 1;
+
+  make_graph();
+  region = region_create(CHUNK_SIZE);
+  if (region == NULL) return 1;
+
+  /* First round draws the chunks, the second one must reuse them */
+  rng_state = 7ULL;
+  if (!build_in_region(region)) ok = 0;
+  memcpy(first_round, ptrs, sizeof(ptrs));
+  region_reset(region);
+  memory_stats(&before);
+  rng_state = 7ULL;
+  if (!build_in_region(region)) ok = 0;
+  memory_stats(&after);
+  region_reset(region);
+  if (memcmp(first_round, ptrs, sizeof(ptrs)) != 0) ok = 0;
+  if ((after.mmap_calls != before.mmap_calls) || (after.mapped_bytes != before.mapped_bytes)) ok = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r=0; r<ROUNDS; r++) {
+    if (!build_in_region(region)) ok = 0;
+    region_reset(region);
+  }
+  region_time = bench_seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r=0; r<ROUNDS; r++) {
+    if (!build_with_malloc()) ok = 0;
+  }
+  malloc_time = bench_seconds_since(&start);
+
+  region_destroy(region);
+
+  printf("%-20s %-6s new mappings after reset %zu, region %7.2f ms/round, malloc/free %7.2f ms/round (%.1fx)\n",
+	 VARIANT, ok ? "ok" : "FAILED", after.mmap_calls - before.mmap_calls,
+	 1e3 * region_time / ROUNDS, 1e3 * malloc_time / ROUNDS,
+	 (region_time > 0.0) ? malloc_time / region_time : 0.0);
+  return ok ? 0 : 1;
+}
@@ -61,6 +61,7 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include "memory_stats.h"
 
 
 
@@ -163,6 +164,72 @@ static int __try_size_t_multiply(size_t *c, size_t a, size_t b) {
 
 */
 
+//Placement policy of the heap free list, chosen at compile time with -DPLACEMENT=PLACEMENT_... (first fit by default).
+//First, next and best fit share one address-ordered free list and merge neighbors on free. Segregated keeps one list per
+//size class, pushes freed blocks without merging and merges all lists at once before it maps new memory.
+#define PLACEMENT_FIRST_FIT 1
+#define PLACEMENT_NEXT_FIT 2
+#define PLACEMENT_BEST_FIT 3
+#define PLACEMENT_SEGREGATED 4
+
+#ifndef PLACEMENT
+#define PLACEMENT PLACEMENT_FIRST_FIT
+#endif
+
+#if (PLACEMENT < PLACEMENT_FIRST_FIT) || (PLACEMENT > PLACEMENT_SEGREGATED)
+#error "PLACEMENT must be one of PLACEMENT_FIRST_FIT, PLACEMENT_NEXT_FIT, PLACEMENT_BEST_FIT or PLACEMENT_SEGREGATED"
+#endif
+
+//Every piece of memory we get from mmap starts with a mapping header. Mappings come in two kinds: heap mappings, which are carved into blocks of
+//any size through the global free list, and spans, which belong to a single thread and hand out small blocks only to that thread
+#define MAPPING_HEAP ((size_t) 0)
+#define MAPPING_SPAN ((size_t) 1)
+#define MAPPING_RETIRED ((size_t) 2)
+
+//All payloads are aligned (and padded) to this many bytes
+#define ALIGNMENT ((size_t) 16)
+
+//Assumed size of a cache line. Memory of two different spans never shares a cache line.
+#define CACHE_LINE_SIZE ((size_t) 64)
+
+//Requests up to this size are small and are served from the calling thread's span. -DNO_SPANS sends them through the heap free
+//list like all others instead, so that the placement policies can be compared on small requests too (small blocks of different
+//threads may then share cache lines).
+#define SMALL_BLOCK_MAX ((size_t) 1024)
+#ifdef NO_SPANS
+#define SPAN_REQUEST_MAX ((size_t) 0)
+#else
+#define SPAN_REQUEST_MAX SMALL_BLOCK_MAX
+#endif
+
+//Small blocks are rounded up to a multiple of SPAN_CLASS_SIZE. Each span keeps one free list per resulting size, so a freed block is
+//only handed out again for a request of the same class.
+#ifdef CACHE_LINE_CLASSES
+#define SPAN_CLASS_SIZE CACHE_LINE_SIZE
+#else
+#define SPAN_CLASS_SIZE ALIGNMENT
+#endif
+#define SPAN_CLASSES (SMALL_BLOCK_MAX / SPAN_CLASS_SIZE)
+
+//Size of one span and minimum size of a heap mapping, so that we do not call mmap for every request
+#define SPAN_SIZE ((size_t) 65536)
+#define HEAP_MAPPING_SIZE ((size_t) 262144)
+
+//Header layout, chosen at compile time: the default header also records how much of the block the user asked for,
+//-DHEADER_COMPACT keeps only size and next
+#ifdef HEADER_COMPACT
+
+typedef struct block {
+  size_t size;
+  struct block *next;
+} block;
+
+#define BLOCK_SET_USED(b, req) ((void) (req))
+#define BLOCK_SET_FREE(b) ((void) (b))
+#define BLOCK_USED_BYTES(b) ((b)->size)
+
+#else
+
 typedef struct block {
   size_t size;
   size_t alloc_mem;
@@ -170,104 +237,800 @@ typedef struct block {
   struct block *next;
 } block;
 
+#define BLOCK_SET_USED(b, req) ((b)->alloc_mem = (req), (b)->free_mem = (b)->size - (req))
+#define BLOCK_SET_FREE(b) ((b)->alloc_mem = 0, (b)->free_mem = (b)->size)
+#define BLOCK_USED_BYTES(b) ((b)->alloc_mem)
+
+#endif
+
+//size: usable bytes after the header, alloc_mem: bytes the user asked for (0 while the block is free), free_mem: size - alloc_mem
+//next: link in a free list while the block is free, pointer to the owning mapping while it is in use
+
+typedef struct mapping {
+  size_t size;
+  size_t kind;
+  size_t live;
+  size_t serial;
+  char *top;
+  struct mapping *next;
+  struct mapping *retired_next;
+  struct mapping **retired_link;
+  struct mapping **class_spans;
+  struct block *class_lists[SPAN_CLASSES];
+  struct mapping *class_next[SPAN_CLASSES];
+  struct mapping **class_link[SPAN_CLASSES];
+} __attribute__((aligned(16))) mapping;
+
+//size: length of the whole mmap'd area, kind: MAPPING_HEAP, MAPPING_SPAN or MAPPING_RETIRED, live: blocks in use
+//serial: number of the mapping in the order we mapped them, tells a mapping apart from an older one that had the same address
+//top: bump pointer for carving new small blocks (spans only)
+//retired_next, retired_link: list of the retired spans of one thread, retired_link points to the pointer that points to us
+//(NULL if the span is on no such list), class_lists: small blocks freed back to this span, by size class (spans only)
+//class_spans: the owning thread's lists of retired spans by size class (NULL unless the span is on the thread's retired list),
+//class_next, class_link: our place in class_spans[c], kept while class_lists[c] is not empty
+
+#if PLACEMENT == PLACEMENT_SEGREGATED
+//Free lists: one per size class. Class 0 holds free blocks below 64 bytes, class i the ones of 2^(i+5) up to 2^(i+6)-1 bytes
+//and the last class everything bigger. A free block keeps a link back to the pointer that points to it in its first payload word.
+#define SIZE_CLASSES 20
+struct block *free_lists[SIZE_CLASSES];
+#define FREE_BLOCK_LINK(b) (*(struct block ***)((b) + 1))
+
+//A miss only merges the free lists once this many bytes have been freed since the last merge, so that it does not sort all free
+//blocks over and over. Under memory pressure, stage 2 merges whatever is left.
+#define MERGE_THRESHOLD ((size_t) 65536)
+static size_t freed_since_merge = 0;
+#else
+//Free list: free blocks of all heap mappings, kept ordered by ascending addresses so that neighbors can be merged
 struct block *free_list = NULL;
+#endif
+
+#if PLACEMENT == PLACEMENT_NEXT_FIT
+//Next fit resumes its search behind this free block (at the start of the free list if NULL)
+static struct block *rover = NULL;
+#endif
+
+//Block list: every mapping we currently hold. It is used to find the mapping a free block belongs to and to unmap unused regions
+struct mapping *block_list = NULL;
+
+//One heap mapping that became unused is kept (its single block stays free) so that a program freeing and allocating around a mapping
+//boundary does not call munmap and mmap each time. It is only given back under memory pressure.
+static struct mapping *spare_mapping = NULL;
+
+//Span the current thread carves its small blocks from. Small blocks handed to different threads come from different spans, so they never
+//share a cache line. All accesses happen under the lock taken in memory.c. memory.c calls __thread_exit_impl when a thread exits,
+//which retires its span.
+static __thread struct mapping *thread_span __attribute__((tls_model("initial-exec"))) = NULL;
+
+//Flushing the spans under memory pressure bumps span_epoch whenever it unmaps one. A thread whose thread_span_epoch is behind must check
+//that its span (identified by address and thread_span_serial) is still mapped before it touches it.
+static size_t span_epoch = 0;
+static __thread size_t thread_span_epoch __attribute__((tls_model("initial-exec"))) = 0;
+static __thread size_t thread_span_serial __attribute__((tls_model("initial-exec"))) = 0;
+static size_t mapping_serial = 0;
+
+//Spans the current thread retired while they still had blocks in use. thread_class_spans[c] lists the ones that have a freed block
+//of size class c, so that the thread finds one in constant time before it maps a new span.
+static __thread struct mapping *thread_retired __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread struct mapping *thread_class_spans[SPAN_CLASSES] __attribute__((tls_model("initial-exec")));
+
+//Counters reported by __memory_stats_impl
+static struct memory_stats stats;
+
+static size_t __round_up(size_t n, size_t to) {
+  return (n + to - 1) & ~(to - 1);
+}
 
-//Block list: each region of memory contains several blocks that are linked to their neighbors. This linked list is used to merge blocks that have been split, unmap unused regions
-struct block *block_list = NULL;
+static int __mapping_contains(struct mapping *m, void *ptr) {
+  return ((char *)ptr > (char *)m) && ((char *)ptr < (char *)m + m->size);
+}
 
-/* End of your helper functions */
+static struct mapping *__mapping_of(struct block *b) {
+  struct mapping *m = block_list;
+  while(!__mapping_contains(m, b)){
+    m = m->next;
+  }
+  return m;
+}
 
-/* Start of the actual malloc/calloc/realloc/free functions */
+//decides whether the unused heap mapping m stays mapped as the spare one
+static int __keep_spare(struct mapping *m) {
+  if(spare_mapping == NULL && m->size == HEAP_MAPPING_SIZE){
+    spare_mapping = m;
+  }
+  return m == spare_mapping;
+}
 
-void __free_impl(void *);
+//Memory-pressure recovery, cheapest stage first: flush the spans, merge the free lists, purge the spare heap mapping.
+//Each stage returns non-zero if it gave anything back.
+#define RECLAIM_STAGES ((size_t) 3)
+static int __reclaim(size_t stage);
+
+static struct mapping *__map_mapping(size_t size, size_t kind) {
+  struct mapping *m = (struct mapping *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  size_t stage = 1;
+
+  //mmap failed: give back what we hold on to, one stage at a time, and try again after every stage that freed something
+  if (m == MAP_FAILED) {
+    stats.mmap_failures++;
+    while(m == MAP_FAILED && stage <= RECLAIM_STAGES){
+      if(__reclaim(stage++)){
+        m = (struct mapping *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      }
+    }
+    if (m == MAP_FAILED) {
+      return NULL;
+    }
+    stats.reclaim_recoveries++;
+  }
+  stats.mmap_calls++;
+  stats.mapped_bytes += size;
+  if(stats.mapped_bytes > stats.peak_mapped_bytes){
+    stats.peak_mapped_bytes = stats.mapped_bytes;
+  }
+  m->size = size;
+  m->kind = kind;
+  m->live = 0;
+  m->serial = ++mapping_serial;
+  m->top = (char *)(m + 1);
+  __memset(m->class_lists, 0, sizeof(m->class_lists));
+  m->next = block_list;
+  m->retired_next = NULL;
+  m->retired_link = NULL;
+  m->class_spans = NULL;
+  __memset(m->class_next, 0, sizeof(m->class_next));
+  __memset(m->class_link, 0, sizeof(m->class_link));
+  block_list = m;
+  return m;
+}
 
+static size_t __span_class(size_t size) {
+  return __round_up(size, SPAN_CLASS_SIZE) / SPAN_CLASS_SIZE - 1;
+}
 
-void *__malloc_impl(size_t size) {
-  /* allocates size bytes of memory, 
-  RETURNS: pointer to the allocated memory, 
-  if size is 0, the function returns NULL or a unique pointer to be passed to free()*/
-  if(size == 0){
+//puts a retired span on its owner's list for size class c, which it has freed blocks of
+static void __link_class_span(struct mapping *span, size_t c) {
+  struct mapping **list = &span->class_spans[c];
+  span->class_next[c] = *list;
+  if(*list){
+    (*list)->class_link[c] = &span->class_next[c];
+  }
+  span->class_link[c] = list;
+  *list = span;
+}
+
+static void __unlink_class_span(struct mapping *span, size_t c) {
+  if(span->class_link[c] == NULL){
+    return;
+  }
+  *span->class_link[c] = span->class_next[c];
+  if(span->class_next[c]){
+    span->class_next[c]->class_link[c] = span->class_link[c];
+  }
+  span->class_next[c] = NULL;
+  span->class_link[c] = NULL;
+}
+
+//takes a retired span off all lists of its owner
+static void __unlink_retired(struct mapping *span) {
+  size_t c;
+
+  if(span->retired_link == NULL){
+    return;
+  }
+  *span->retired_link = span->retired_next;
+  if(span->retired_next){
+    span->retired_next->retired_link = span->retired_link;
+  }
+  span->retired_next = NULL;
+  span->retired_link = NULL;
+  for(c = 0; c < SPAN_CLASSES; c++){
+    __unlink_class_span(span, c);
+  }
+  span->class_spans = NULL;
+}
+
+static void __unmap_mapping(struct mapping *m) {
+  struct mapping **link = &block_list;
+  if(m == spare_mapping){
+    spare_mapping = NULL;
+  }
+  __unlink_retired(m);
+  while(*link != m){
+    link = &(*link)->next;
+  }
+  *link = m->next;
+  stats.munmap_calls++;
+  stats.mapped_bytes -= m->size;
+  munmap(m, m->size);
+}
+
+//Hands out a small block of a span. Returns NULL if the span has neither a freed block of the right class nor enough room left.
+static struct block *__span_alloc(struct mapping *span, size_t size) {
+  size_t c = __span_class(size);
+  size_t need = (c + 1) * SPAN_CLASS_SIZE;
+  struct block **list = &span->class_lists[c];
+  struct block *new_block;
+  char *payload;
+
+  //reuse a block of the same class this span has handed out before
+  if(*list){
+    new_block = *list;
+    *list = new_block->next;
+    if(*list == NULL){
+      __unlink_class_span(span, c);
+    }
+    span->live++;
+    new_block->next = (struct block *)span;
+    return new_block;
+  }
+
+  //carve a new block at the bump pointer
+#ifdef CACHE_LINE_CLASSES
+  //cache-line size classes: every payload starts on its own line and fills whole lines, so even two blocks of the same thread never share one
+  payload = (char *)__round_up((size_t)(span->top + sizeof(struct block)), CACHE_LINE_SIZE);
+#else
+  payload = span->top + sizeof(struct block);
+#endif
+  if(payload + need > (char *)span + span->size){
     return NULL;
   }
-  size_t total_size = size + sizeof(struct block);
+  new_block = (struct block *)payload - 1;
+  new_block->size = need;
+  new_block->next = (struct block *)span;
+  span->top = payload + need;
+  span->live++;
+  return new_block;
+}
+
+//Retires a span nobody carves from anymore. It is unmapped right away if it has no block in use, otherwise it is unmapped once its last
+//block comes back. If reuse is non-zero, the current thread keeps it on its lists to hand out its freed blocks again until then.
+static void __retire_span(struct mapping *span, int reuse) {
+  size_t c;
+
+  span->kind = MAPPING_RETIRED;
+  if(span->live == 0){
+    __unmap_mapping(span);
+    return;
+  }
+  if(reuse){
+    span->retired_next = thread_retired;
+    if(thread_retired){
+      thread_retired->retired_link = &span->retired_next;
+    }
+    span->retired_link = &thread_retired;
+    thread_retired = span;
+    span->class_spans = thread_class_spans;
+    for(c = 0; c < SPAN_CLASSES; c++){
+      if(span->class_lists[c]){
+        __link_class_span(span, c);
+      }
+    }
+  }
+}
+
+//Returns the span of the current thread, or NULL if a flush under memory pressure unmapped it since the thread last looked
+static struct mapping *__current_span(void) {
+  struct mapping *m;
+
+  if(thread_span == NULL || thread_span_epoch == span_epoch){
+    return thread_span;
+  }
+  thread_span_epoch = span_epoch;
+  //the address alone does not do, a newer mapping may have taken the place of our span
+  for(m = block_list; m; m = m->next){
+    if(m == thread_span && m->serial == thread_span_serial){
+      return thread_span;
+    }
+  }
+  thread_span = NULL;
+  return NULL;
+}
+
+static void *__malloc_small(size_t size) {
+  struct block *new_block = NULL;
+
+  if(__current_span()){
+    new_block = __span_alloc(thread_span, size);
+  }
+  //the current span is exhausted for this size: take a freed block of a span this thread retired before
+  if(new_block == NULL && thread_class_spans[__span_class(size)]){
+    new_block = __span_alloc(thread_class_spans[__span_class(size)], size);
+  }
+  if(new_block == NULL){
+    //no luck either: retire the current span and start a new one
+    struct mapping *span = __map_mapping(SPAN_SIZE, MAPPING_SPAN);
+    if(span == NULL){
+      stats.out_of_memory++;
+      return NULL;
+    }
+    //mapping the new span may have flushed the old one
+    if(__current_span()){
+      __retire_span(thread_span, 1);
+    }
+    thread_span = span;
+    thread_span_epoch = span_epoch;
+    thread_span_serial = span->serial;
+    new_block = __span_alloc(span, size);
+  }
+  BLOCK_SET_USED(new_block, size);
+  return (void *)(new_block + 1);
+}
+
+static void __free_small(struct block *curr, struct mapping *span) {
+  size_t c = __span_class(curr->size);
+  struct block **list = &span->class_lists[c];
+
+  //the first freed block of its class makes a retired span worth going back to for its owner
+  if(*list == NULL && span->class_spans){
+    __link_class_span(span, c);
+  }
+  curr->next = *list;
+  *list = curr;
+  span->live--;
+  if(span->live != 0){
+    return;
+  }
+  if(span->kind == MAPPING_RETIRED){
+    __unmap_mapping(span);
+    return;
+  }
+  //the owning thread still carves from this span, start over from its beginning
+  span->top = (char *)(span + 1);
+  __memset(span->class_lists, 0, sizeof(span->class_lists));
+}
+
+//Heap free list, one implementation per placement policy:
+//__take_free_block unlinks and returns a free block of at least need bytes (NULL if there is none),
+//__put_free_block gives a free block of mapping m back (and the mapping to the kernel once none of its blocks is in use),
+//__coalesce_free_blocks merges neighbors that are still apart (unless it thinks it is not worth it yet and force is 0) and returns
+//non-zero if it changed anything, __unlink_free_block takes a given block out.
+
+#if PLACEMENT == PLACEMENT_SEGREGATED
+
+static size_t __size_class(size_t size) {
+  size_t c = 0;
+  size >>= 6;
+  while(size && c < SIZE_CLASSES - 1){
+    size >>= 1;
+    c++;
+  }
+  return c;
+}
+
+static void __push_free_block(struct block *b) {
+  struct block **list = &free_lists[__size_class(b->size)];
+  b->next = *list;
+  if(*list){
+    FREE_BLOCK_LINK(*list) = &b->next;
+  }
+  FREE_BLOCK_LINK(b) = list;
+  *list = b;
+}
+
+static void __unlink_free_block(struct block *b) {
+  *FREE_BLOCK_LINK(b) = b->next;
+  if(b->next){
+    FREE_BLOCK_LINK(b->next) = FREE_BLOCK_LINK(b);
+  }
+}
+
+static struct block *__take_free_block(size_t need) {
+  struct block *curr;
+  size_t c;
+
+  //first fit in the own class, whatever comes first in the bigger ones
+  for(c = __size_class(need); c < SIZE_CLASSES; c++){
+    for(curr = free_lists[c]; curr; curr = curr->next){
+      if(curr->size >= need){
+        __unlink_free_block(curr);
+        return curr;
+      }
+    }
+  }
+  return NULL;
+}
+
+//The last block in use of heap mapping m came back: take its free blocks out of the lists and give the mapping back to the kernel,
+//or keep it as the spare one with a single free block
+static void __release_heap_mapping(struct mapping *m) {
+  struct block *b;
+
+  for(b = (struct block *)(m + 1); (char *)b < (char *)m + m->size; b = (struct block *)((char *)(b + 1) + b->size)){
+    __unlink_free_block(b);
+  }
+  if(!__keep_spare(m)){
+    __unmap_mapping(m);
+    return;
+  }
+  b = (struct block *)(m + 1);
+  b->size = m->size - sizeof(struct mapping) - sizeof(struct block);
+  BLOCK_SET_FREE(b);
+  __push_free_block(b);
+}
+
+static void __put_free_block(struct block *b, struct mapping *m) {
+  //neighbors wait for __coalesce_free_blocks, a mapping without blocks in use goes right away
+  BLOCK_SET_FREE(b);
+  __push_free_block(b);
+  if(m->live == 0){
+    __release_heap_mapping(m);
+  }
+}
+
+//merge sort of a free list by ascending addresses
+static struct block *__sort_free_blocks(struct block *list) {
+  struct block *a = NULL;
+  struct block *b = NULL;
+  struct block *head = NULL;
+  struct block **tail = &head;
+
+  if(list == NULL || list->next == NULL){
+    return list;
+  }
+  while(list){
+    struct block *next = list->next;
+    list->next = a;
+    a = list;
+    list = next;
+    if(list){
+      next = list->next;
+      list->next = b;
+      b = list;
+      list = next;
+    }
+  }
+  a = __sort_free_blocks(a);
+  b = __sort_free_blocks(b);
+  while(a && b){
+    if(a < b){
+      *tail = a;
+      a = a->next;
+    }
+    else{
+      *tail = b;
+      b = b->next;
+    }
+    tail = &(*tail)->next;
+  }
+  *tail = a ? a : b;
+  return head;
+}
+
+static int __coalesce_free_blocks(int force) {
+  struct block *all = NULL;
+  struct block *curr;
+  int changed = 0;
+  size_t c;
+
+  if(!force && freed_since_merge < MERGE_THRESHOLD){
+    return 0;
+  }
+  freed_since_merge = 0;
+  for(c = 0; c < SIZE_CLASSES; c++){
+    while(free_lists[c]){
+      curr = free_lists[c];
+      free_lists[c] = curr->next;
+      curr->next = all;
+      all = curr;
+    }
+  }
+  all = __sort_free_blocks(all);
+
+  while(all){
+    curr = all;
+    all = all->next;
+    //blocks never start right at a mapping header, so touching blocks always belong to the same mapping
+    while(all && (char *)(curr + 1) + curr->size == (char *)all){
+      curr->size += sizeof(struct block) + all->size;
+      all = all->next;
+      changed = 1;
+    }
+    BLOCK_SET_FREE(curr);
+    __push_free_block(curr);
+  }
+  return changed;
+}
+
+#else
+
+//a free block that covers its whole heap mapping means the mapping is unused
+static int __block_fills_mapping(struct block *b, struct mapping *m) {
+  return (b == (struct block *)(m + 1)) && ((char *)(b + 1) + b->size == (char *)m + m->size);
+}
+
+static struct block *__take_free_block(size_t need) {
   struct block *curr = free_list;
+  struct block *prev = NULL;
 
+#if PLACEMENT == PLACEMENT_FIRST_FIT
+  while(curr && curr->size < need){
+    prev = curr;
+    curr = curr->next;
+  }
+#elif PLACEMENT == PLACEMENT_NEXT_FIT
+  //search from the rover to the end, then wrap around to the start
+  struct block *start = rover;
+  if(rover){
+    prev = rover;
+    curr = rover->next;
+  }
+  while(curr && curr->size < need){
+    prev = curr;
+    curr = curr->next;
+  }
+  if(curr == NULL && start){
+    prev = NULL;
+    curr = free_list;
+    while(curr != start && curr->size < need){
+      prev = curr;
+      curr = curr->next;
+    }
+    if(curr == start && curr->size < need){
+      curr = NULL;
+    }
+  }
+#else
+  //best fit: the smallest block that is big enough, stop early on an exact fit
+  struct block *best = NULL;
+  struct block *best_prev = NULL;
   while(curr){
-    //found a block that is big enough
-    if(curr->free_mem > total_size){
-      //creating a new block at the end of the allocated memory
-      char *block_end = (char *)curr + curr->free_mem;
-      struct block *new_block = (struct block *)block_end;
-
-      new_block->size = curr->free_mem - sizeof(struct block);
-      new_block->alloc_mem = size;
-      new_block->free_mem = new_block->size - new_block->alloc_mem;
-
-      curr->size = curr->alloc_mem;
-      curr->free_mem = 0;
-      new_block->next = curr->next;
-      curr->next = new_block;
-
-      //new block is big enough to split
-      if(new_block->free_mem > sizeof(struct block)){
-        char *block_end = (char *)new_block + new_block->free_mem;
-        struct block *free_block = (struct block *)block_end;
-        free_block->size = new_block->free_mem - sizeof(struct block);
-        free_block->alloc_mem = 0;
-        free_block->free_mem = free_block->size - free_block->alloc_mem;
-        new_block->size = new_block->alloc_mem;
-        new_block->free_mem = 0;
-        free_block->next = new_block->next;
-        new_block->next = free_block;
-        if(free_list == NULL){
-          free_list = free_block;
-        }
-        else{
-          struct block *temp = free_list;
-          while(temp){
-            if(temp->next == NULL){
-              temp->next = free_block;
-              break;
-            }
-            temp = temp->next;
-          }
-        }
+    if(curr->size >= need && (best == NULL || curr->size < best->size)){
+      best = curr;
+      best_prev = prev;
+      if(curr->size == need){
+        break;
       }
-      return (void *)(new_block + 1);
     }
+    prev = curr;
     curr = curr->next;
+  }
+  curr = best;
+  prev = best_prev;
+#endif
 
+  if(curr == NULL){
+    return NULL;
   }
+  if(prev == NULL){
+    free_list = curr->next;
+  }
+  else{
+    prev->next = curr->next;
+  }
+#if PLACEMENT == PLACEMENT_NEXT_FIT
+  rover = prev;
+#endif
+  return curr;
+}
 
-  //no block is big enough, need to allocate a new block using mmap and linking it to the block list
-  size_t page_size = getpagesize();
-  size_t num_pages = (total_size + page_size - 1) / page_size;
-  total_size = num_pages * page_size;
-  struct block *new_block = (struct block *)mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (new_block == MAP_FAILED) {
-      return NULL;
+static void __put_free_block(struct block *curr, struct mapping *m) {
+  struct block *prev = NULL;
+  struct block *next = free_list;
+
+  //find our place in the address-ordered free list
+  while(next && next < curr){
+    prev = next;
+    next = next->next;
+  }
+
+  //merge with the following block if it is our direct neighbor in the same mapping
+  if(next && __mapping_contains(m, next) && (char *)(curr + 1) + curr->size == (char *)next){
+    curr->size += sizeof(struct block) + next->size;
+#if PLACEMENT == PLACEMENT_NEXT_FIT
+    if(rover == next){
+      rover = curr;
+    }
+#endif
+    next = next->next;
   }
-  new_block->size = total_size - sizeof(struct block);
-  new_block->alloc_mem = size;
-  new_block->free_mem = new_block->size - new_block->alloc_mem;
-  new_block->next = block_list;
-  if(block_list == NULL){
-    block_list = new_block;
+  curr->next = next;
+
+  //merge with the preceding block the same way
+  if(prev && __mapping_contains(m, prev) && (char *)(prev + 1) + prev->size == (char *)curr){
+    prev->size += sizeof(struct block) + curr->size;
+    prev->next = next;
+#if PLACEMENT == PLACEMENT_NEXT_FIT
+    if(rover == curr){
+      rover = prev;
+    }
+#endif
+    curr = prev;
+  }
+  else if(prev){
+    prev->next = curr;
   }
-  //insert to end of block list
   else{
-    struct block *temp = block_list;
-    while(temp){
-      if(temp->next == NULL){
-        temp->next = new_block;
-        break;
+    free_list = curr;
+  }
+  BLOCK_SET_FREE(curr);
+
+  //the whole mapping is free again, give it back to the kernel unless we keep it as the spare one
+  if(__block_fills_mapping(curr, m) && !__keep_spare(m)){
+    if(free_list == curr){
+      free_list = curr->next;
+      prev = NULL;
+    }
+    else{
+      prev = free_list;
+      while(prev->next != curr){
+        prev = prev->next;
       }
-      temp = temp->next;
+      prev->next = curr->next;
+    }
+#if PLACEMENT == PLACEMENT_NEXT_FIT
+    if(rover == curr){
+      rover = prev;
     }
+#endif
+    __unmap_mapping(m);
   }
+}
 
-  return (void *)(new_block + 1);
+//neighbors are merged on every free already
+static int __coalesce_free_blocks(int force) {
+  (void) force;
+  return 0;
+}
+
+static void __unlink_free_block(struct block *b) {
+  struct block *prev = NULL;
+  struct block *curr = free_list;
+  while(curr != b){
+    prev = curr;
+    curr = curr->next;
+  }
+  if(prev == NULL){
+    free_list = b->next;
+  }
+  else{
+    prev->next = b->next;
+  }
+#if PLACEMENT == PLACEMENT_NEXT_FIT
+  if(rover == b){
+    rover = prev;
+  }
+#endif
+}
+
+#endif
+
+static void *__malloc_large(size_t size) {
+  size_t need = __round_up(size, ALIGNMENT);
+  struct block *curr = __take_free_block(need);
+  struct mapping *m = NULL;
+
+  //merge what has been freed since the last time before asking the kernel
+  if(curr == NULL && __coalesce_free_blocks(0)){
+    curr = __take_free_block(need);
+  }
+
+  if(curr == NULL){
+    //no block is big enough, need to get a new heap mapping that holds a single free block
+    size_t total_size = __round_up(sizeof(struct mapping) + sizeof(struct block) + need, (size_t)getpagesize());
+    if(total_size < HEAP_MAPPING_SIZE){
+      total_size = HEAP_MAPPING_SIZE;
+    }
+    m = __map_mapping(total_size, MAPPING_HEAP);
+    if(m){
+      curr = (struct block *)(m + 1);
+      curr->size = total_size - sizeof(struct mapping) - sizeof(struct block);
+    }
+    else{
+      //the reclaim stages may have merged a block that fits after all
+      curr = __take_free_block(need);
+      if(curr == NULL){
+        stats.out_of_memory++;
+        return NULL;
+      }
+      stats.reclaim_recoveries++;
+    }
+  }
+  if(m == NULL){
+    m = __mapping_of(curr);
+  }
+  if(m == spare_mapping){
+    spare_mapping = NULL;
+  }
+  m->live++;
+
+  //split the block if the rest is big enough to hold another block, the rest goes back to the free list
+  if(curr->size >= need + sizeof(struct block) + ALIGNMENT){
+    struct block *rest = (struct block *)((char *)(curr + 1) + need);
+    rest->size = curr->size - need - sizeof(struct block);
+    curr->size = need;
+    __put_free_block(rest, m);
+  }
+
+  BLOCK_SET_USED(curr, size);
+  curr->next = (struct block *)m;
+  return (void *)(curr + 1);
+}
+
+static void __free_large(struct block *curr, struct mapping *m) {
+  m->live--;
+#if PLACEMENT == PLACEMENT_SEGREGATED
+  freed_since_merge += curr->size;
+#endif
+  __put_free_block(curr, m);
+}
+
+//stage 1: unmap the spans without blocks in use, including the ones other threads carve from. Spans with blocks in use stay
+//with their threads, taking them away would not free anything.
+static int __flush_spans(void) {
+  struct mapping *m = block_list;
+  struct mapping *next;
+  int changed = 0;
+
+  while(m){
+    next = m->next;
+    if(m->kind != MAPPING_HEAP && m->live == 0){
+      __unmap_mapping(m);
+      changed = 1;
+    }
+    m = next;
+  }
+  //tell the threads to check their spans
+  if(changed){
+    span_epoch++;
+  }
+  return changed;
+}
+
+//stage 3: give the spare heap mapping back
+static int __purge_spare(void) {
+  if(spare_mapping == NULL){
+    return 0;
+  }
+  __unlink_free_block((struct block *)(spare_mapping + 1));
+  __unmap_mapping(spare_mapping);
+  return 1;
+}
+
+static int __reclaim(size_t stage) {
+  if(stage == 1){
+    if(!__flush_spans()){
+      return 0;
+    }
+    stats.reclaim_flushes++;
+  }
+  else if(stage == 2){
+    if(!__coalesce_free_blocks(1)){
+      return 0;
+    }
+    stats.reclaim_coalesces++;
+  }
+  else{
+    if(!__purge_spare()){
+      return 0;
+    }
+    stats.reclaim_purges++;
+  }
+  return 1;
+}
+
+/* End of your helper functions */
 
+/* Start of the actual malloc/calloc/realloc/free functions */
+
+void __free_impl(void *);
+
+
+void *__malloc_impl(size_t size) {
+  /* allocates size bytes of memory, 
+  RETURNS: pointer to the allocated memory, 
+  if size is 0, the function returns NULL or a unique pointer to be passed to free()*/
+  if(size == 0){
+    return NULL;
+  }
+  //refuse sizes whose rounding or header would overflow
+  if(size > ((size_t) -1) / 2){
+    return NULL;
+  }
+  if(size <= SPAN_REQUEST_MAX){
+    return __malloc_small(size);
+  }
+  return __malloc_large(size);
 }
 
 void *__calloc_impl(size_t nmemb, size_t size) {
@@ -311,12 +1074,14 @@ void *__realloc_impl(void *ptr, size_t size) {
     return NULL;
   }
   struct block *curr = (struct block *)((char *)ptr - sizeof(struct block));
-  if(size <= curr->alloc_mem){
+  //the block still fits, only its bookkeeping changes
+  if(size <= curr->size){
+    BLOCK_SET_USED(curr, size);
     return ptr;
   }
   void *new_ptr = __malloc_impl(size);
   if(new_ptr){
-    __memcpy(new_ptr, ptr, curr->alloc_mem);
+    __memcpy(new_ptr, ptr, BLOCK_USED_BYTES(curr));
     __free_impl(ptr);
   }
   return new_ptr;
@@ -336,24 +1101,38 @@ void __free_impl(void *ptr) {
     return;
   }
   struct block *curr = (struct block *)((char *)ptr - sizeof(struct block));
-  curr->alloc_mem = 0;
-  curr->free_mem = curr->size;
-  if(free_list == NULL){
-    free_list = curr;
+  struct mapping *m = (struct mapping *)curr->next;
+  //small blocks go back to the span they were carved from, whichever thread frees them
+  if(m->kind == MAPPING_HEAP){
+    __free_large(curr, m);
   }
-  //insert to end of free list
   else{
-    struct block *temp = free_list;
-    while(temp){
-      if(temp->next == NULL){
-        temp->next = curr;
-        break;
-      }
-      temp = temp->next;
-    }
+    __free_small(curr, m);
   }
 
 }
 
-/* End of the actual malloc/calloc/realloc/free functions */
+void __thread_exit_impl(void) {
+  /*called by memory.c when a thread that allocated memory exits
+  RETURNS: nothing
 
+  The thread's current span is retired (and unmapped if it has no block in use). Its retired spans stay
+  until their last block is freed, but they are taken off the thread's lists as nobody will go back to them.
+  */
+  if(__current_span()){
+    __retire_span(thread_span, 0);
+  }
+  thread_span = NULL;
+  while(thread_retired){
+    __unlink_retired(thread_retired);
+  }
+}
+
+void __memory_stats_impl(struct memory_stats *s) {
+  /*s: where to store a copy of the allocator's counters
+  RETURNS: nothing
+  */
+  *s = stats;
+}
+
+/* End of the actual malloc/calloc/realloc/free functions */
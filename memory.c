@@ -16,7 +16,15 @@
 
     gcc -fPIC -Wall -g -O0 -c memory.c 
     gcc -fPIC -Wall -g -O0 -c implementation.c
-    gcc -fPIC -shared -o memory.so memory.o implementation.o -lpthread
+    gcc -fPIC -Wall -g -O0 -c region.c
+    gcc -fPIC -shared -o memory.so memory.o implementation.o region.o -lpthread
+
+    Besides malloc/calloc/realloc/free, memory.so exports the region
+    (arena) API declared in region.h.
+
+    Running make does the same. The placement policy and the header
+    layout of implementation.c are chosen at compile time; see the
+    Makefile for the variants and "make bench" to compare them.
 
     To try the code out:
 
@@ -67,6 +75,24 @@
       created with mmap. All mappings must be unmapped using munmap,
       at least for programs that free all their memory before exiting.
 
+      There are two deliberate exceptions in implementation.c, so that
+      a program that frees and reallocates around a boundary does not
+      pay an munmap/mmap pair every time:
+
+      - one empty 256 KiB heap mapping (the spare one) stays mapped,
+
+      - every thread that has allocated small blocks keeps its current
+        64 KiB span, even once all its blocks are freed, until the
+        thread exits.
+
+      The price is that a program that frees everything still has
+      256 KiB plus 64 KiB per live thread mapped. Both are only given
+      back earlier when mmap fails (see the reclaim stages in
+      implementation.c and "make pressure"), so do not count them as
+      a leak when you check. Every other heap mapping is unmapped as
+      soon as none of its blocks is in use, whatever the placement
+      policy.
+
     * The ultimate test is to run some huge application such as libreoffice
       with your wrapper. It can be slow but it must not crash.
 
@@ -84,12 +110,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include "memory_stats.h"
 
 
 void *__malloc_impl(size_t);
 void *__calloc_impl(size_t, size_t);
 void *__realloc_impl(void *, size_t);
 void __free_impl(void *);
+void __memory_stats_impl(struct memory_stats *);
+void __thread_exit_impl(void);
 
 static int __memory_print_debug_running = 0;
 static int __memory_print_debug_init_running = 0;
@@ -99,6 +128,10 @@ static int __memory_print_debug_do_it = 0;
 static pthread_mutex_t memory_management_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
 
+static pthread_key_t thread_exit_key;
+static pthread_once_t thread_exit_once = PTHREAD_ONCE_INIT;
+static __thread int thread_exit_registered __attribute__((tls_model("initial-exec"))) = 0;
+
 static void __memory_print_debug_init() {
   char *env_var;
   
@@ -136,9 +169,35 @@ static void __memory_print_debug(const char *fmt, ...) {
   pthread_mutex_unlock(&print_lock);
 }
 
+/* Every thread that allocates gets a thread-specific value so that
+   __memory_thread_exit runs when it exits and the implementation can
+   give back what it keeps per thread. If the thread allocates again
+   while its destructors run, it registers again and glibc calls
+   __memory_thread_exit another time. */
+
+static void __memory_thread_exit(void *arg) {
+  (void) arg;
+  pthread_mutex_lock(&memory_management_lock);
+  __thread_exit_impl();
+  pthread_mutex_unlock(&memory_management_lock);
+  thread_exit_registered = 0;
+}
+
+static void __memory_thread_exit_init() {
+  pthread_key_create(&thread_exit_key, __memory_thread_exit);
+}
+
+static void __memory_thread_register() {
+  if (thread_exit_registered) return;
+  thread_exit_registered = 1;
+  pthread_once(&thread_exit_once, __memory_thread_exit_init);
+  pthread_setspecific(thread_exit_key, (void *) 1);
+}
+
 void *malloc(size_t size) {
   void *ptr;
 
+  __memory_thread_register();
   pthread_mutex_lock(&memory_management_lock);
   ptr = __malloc_impl(size);
   pthread_mutex_unlock(&memory_management_lock);
@@ -149,6 +208,7 @@ void *malloc(size_t size) {
 void *calloc(size_t nmemb, size_t size) {
   void *ptr;
 
+  __memory_thread_register();
   pthread_mutex_lock(&memory_management_lock);
   ptr = __calloc_impl(nmemb, size);
   pthread_mutex_unlock(&memory_management_lock);
@@ -159,6 +219,7 @@ void *calloc(size_t nmemb, size_t size) {
 void *realloc(void *old_ptr, size_t size) {
   void *ptr;
 
+  __memory_thread_register();
   pthread_mutex_lock(&memory_management_lock);
   ptr = __realloc_impl(old_ptr, size);
   pthread_mutex_unlock(&memory_management_lock);
@@ -173,3 +234,9 @@ void free(void *ptr) {
   __memory_print_debug("free(%p)\n", ptr);
 }
 
+void memory_stats(struct memory_stats *stats) {
+  pthread_mutex_lock(&memory_management_lock);
+  __memory_stats_impl(stats);
+  pthread_mutex_unlock(&memory_management_lock);
+}
+
@@ -0,0 +1,29 @@
+/*  
+
+    Counters of the allocator in implementation.c, exported by
+    memory.so through memory_stats.
+
+*/
+
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <stddef.h>
+
+struct memory_stats {
+  size_t mapped_bytes;        /* Bytes currently mapped with mmap */
+  size_t peak_mapped_bytes;   /* Highest value mapped_bytes has reached */
+  size_t mmap_calls;          /* Successful calls to mmap */
+  size_t munmap_calls;        /* Calls to munmap */
+  size_t mmap_failures;       /* Calls to mmap that failed and started the reclaim stages */
+  size_t reclaim_flushes;     /* Stage 1: span flushes that unmapped at least one span */
+  size_t reclaim_coalesces;   /* Stage 2: free list merges that merged or unmapped anything */
+  size_t reclaim_purges;      /* Stage 3: spare heap mappings given back */
+  size_t reclaim_recoveries;  /* Requests served after a failed mmap thanks to the stages */
+  size_t out_of_memory;       /* Requests that failed even after all stages */
+};
+
+/* Copies the current counters to the structure pointed to by stats. */
+void memory_stats(struct memory_stats *stats);
+
+#endif
@@ -0,0 +1,135 @@
+/*  
+
+    Implementation of the region API declared in region.h.
+
+    The chunks of a region come from malloc and free, i.e. from the
+    main heap implemented in implementation.c when this file is built
+    into memory.so (see file memory.c on how to compile it). Locking
+    is hence only done when a chunk is needed, never for the bump
+    allocation itself.
+
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "region.h"
+
+#define REGION_DEFAULT_CHUNK_SIZE ((size_t) 65536)
+#define REGION_DEFAULT_ALIGNMENT ((size_t) 16)
+
+typedef struct region_chunk {
+  struct region_chunk *next;
+  size_t size;
+} region_chunk;
+
+struct region {
+  region_chunk *first;
+  region_chunk *current;
+  char *top;
+  char *end;
+  size_t chunk_size;
+};
+
+static char *__region_chunk_start(region_chunk *chunk) {
+  return (char *) (chunk + 1);
+}
+
+static char *__region_chunk_end(region_chunk *chunk) {
+  return __region_chunk_start(chunk) + chunk->size;
+}
+
+/* Returns the first address at or above top that is aligned to
+   alignment and leaves room for size bytes before end, or NULL. */
+static char *__region_fit(char *top, char *end, size_t size, size_t alignment) {
+  uintptr_t p;
+
+  if (top == NULL) return NULL;
+  p = ((uintptr_t) top + (uintptr_t) (alignment - 1)) & ~((uintptr_t) (alignment - 1));
+  if (p < (uintptr_t) top) return NULL;
+  if (p > (uintptr_t) end) return NULL;
+  if (size > (size_t) ((uintptr_t) end - p)) return NULL;
+  return (char *) p;
+}
+
+region_t *region_create(size_t chunk_size) {
+  region_t *region;
+
+  region = malloc(sizeof(region_t));
+  if (region == NULL) return NULL;
+  region->first = NULL;
+  region->current = NULL;
+  region->top = NULL;
+  region->end = NULL;
+  region->chunk_size = (chunk_size == ((size_t) 0)) ? REGION_DEFAULT_CHUNK_SIZE : chunk_size;
+  return region;
+}
+
+void *region_alloc(region_t *region, size_t size, size_t alignment) {
+  region_chunk *chunk;
+  char *ptr;
+  size_t chunk_size;
+
+  if (alignment == ((size_t) 0)) alignment = REGION_DEFAULT_ALIGNMENT;
+  if ((size == ((size_t) 0)) || ((alignment & (alignment - 1)) != ((size_t) 0))) return NULL;
+
+  /* Fast path: bump the pointer in the current chunk */
+  ptr = __region_fit(region->top, region->end, size, alignment);
+  if (ptr != NULL) {
+    region->top = ptr + size;
+    return ptr;
+  }
+
+  /* Move on to the next chunk kept from before the last reset that is
+     large enough */
+  chunk = (region->current == NULL) ? region->first : region->current->next;
+  for (; chunk != NULL; chunk=chunk->next) {
+    ptr = __region_fit(__region_chunk_start(chunk), __region_chunk_end(chunk), size, alignment);
+    if (ptr != NULL) {
+      region->current = chunk;
+      region->top = ptr + size;
+      region->end = __region_chunk_end(chunk);
+      return ptr;
+    }
+  }
+
+  /* Draw a new chunk from the heap, large enough for oversized
+     requests, and link it in behind the current one */
+  chunk_size = region->chunk_size;
+  if ((size > ((size_t) SIZE_MAX) - alignment) ||
+      (size + alignment > ((size_t) SIZE_MAX) - sizeof(region_chunk))) return NULL;
+  if (chunk_size < size + alignment) chunk_size = size + alignment;
+  chunk = malloc(sizeof(region_chunk) + chunk_size);
+  if (chunk == NULL) return NULL;
+  chunk->size = chunk_size;
+  if (region->current == NULL) {
+    chunk->next = region->first;
+    region->first = chunk;
+  } else {
+    chunk->next = region->current->next;
+    region->current->next = chunk;
+  }
+  ptr = __region_fit(__region_chunk_start(chunk), __region_chunk_end(chunk), size, alignment);
+  region->current = chunk;
+  region->top = ptr + size;
+  region->end = __region_chunk_end(chunk);
+  return ptr;
+}
+
+void region_reset(region_t *region) {
+  region->current = region->first;
+  if (region->first == NULL) return;
+  region->top = __region_chunk_start(region->first);
+  region->end = __region_chunk_end(region->first);
+}
+
+void region_destroy(region_t *region) {
+  region_chunk *chunk, *next;
+
+  if (region == NULL) return;
+  for (chunk=region->first; chunk != NULL; chunk=next) {
+    next = chunk->next;
+    free(chunk);
+  }
+  free(region);
+}
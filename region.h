@@ -0,0 +1,40 @@
+/*  
+
+    Regions (arenas) with bulk free, exported by memory.so.
+
+    A region hands out memory by bumping a pointer through chunks it
+    draws from the main heap. Objects allocated in a region are never
+    freed one by one: region_reset gives all of them back at once and
+    keeps the chunks for the next round, region_destroy gives the
+    chunks back to the heap.
+
+    A region must not be used by several threads at the same time
+    without external locking.
+
+*/
+
+#ifndef REGION_H
+#define REGION_H
+
+#include <stddef.h>
+
+typedef struct region region_t;
+
+/* Creates an empty region drawing chunks of at least chunk_size
+   bytes from the heap (a default size is used if chunk_size is 0).
+   Returns NULL if the region cannot be allocated. */
+region_t *region_create(size_t chunk_size);
+
+/* Allocates size bytes aligned to alignment, which must be a power
+   of two (0 stands for the alignment malloc guarantees). Returns NULL
+   if size is 0, if alignment is invalid or if no chunk can be had. */
+void *region_alloc(region_t *region, size_t size, size_t alignment);
+
+/* Frees everything allocated in the region. The chunks are kept and
+   reused by the following allocations. */
+void region_reset(region_t *region);
+
+/* Frees everything allocated in the region and the region itself. */
+void region_destroy(region_t *region);
+
+#endif